@@ -0,0 +1,469 @@
+//-*- Mode: C++ -*-
+#ifndef TPCRAWDECODER_H
+#define TPCRAWDECODER_H
+/// @file   TPCRawDecoder.h
+/// @author Matthias.Richter@scieq.net
+/// @date   2026-10-17
+/// @brief  Single pass decoding of TPC raw data with pluggable analyzers
+///
+/// The decoder runs the AliAltroRawStreamV3 loop over DDLs, channels and bunches
+/// once and fills a reusable channel buffer, which is handed to all registered
+/// analyzers. Like this, the statistics of the different macros are produced
+/// from one pass over the raw data, e.g.
+///   read-tpc-raw.C           huffman compression, spikes, sample channel, timing
+///   tpc-raw-rle-reduction.C  ALTRO bunch length and RLE reduction
+///
+/// For parallel processing, the decoder and all analyzers are cloned for every
+/// worker and merged at the end.
+///
+/// With stage timing enabled, the time of the decoding, of the signal arrays
+/// and of every analyzer is measured separately, see tpc-benchmark.C.
+
+#include "AliRawReader.h"
+#include "AliAltroRawStreamV3.h"
+#include "TTree.h"
+#include "TH1.h"
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+/// properties of the event being processed
+struct TPCRawEventInfo {
+  TPCRawEventInfo() : fFile(-1), fEvent(-1), fEventNumber(-1), fUnit(-1), fTimestamp(0), fNofClusters(0) {}
+  int    fFile;        // index of the input file
+  int    fEvent;       // event index in the file
+  int    fEventNumber; // event index in the complete input
+  int    fUnit;        // work unit, increasing in the order of the serial processing
+  UInt_t fTimestamp;   // event timestamp
+  int    fNofClusters; // optional number of clusters from the input configuration
+};
+
+/// one ALTRO bunch, the samples are stored in the sample buffer of the channel
+struct TPCRawBunch {
+  Int_t fStartTime;
+  Int_t fLength;
+  Int_t fOffset;
+};
+
+/**
+ * Reusable buffer of the decoded channel.
+ *
+ * The bunch list, samples and word count are always filled. The signal arrays
+ * in time bin representation are only filled if one of the analyzers needs them,
+ * the signals are normalized to the minimum signal of the channel and the
+ * differences are calculated in the ALTRO readout direction, i.e. the element at
+ * the highest time bin holds the first signal.
+ */
+struct TPCRawChannel {
+  TPCRawChannel(int maxChannelLength=1024)
+    : fEvent(NULL), fDDLNumber(-1), fHWAddress(-1), fWordCount(0)
+    , fBunches(), fSamples()
+    , fMaxChannelLength(maxChannelLength)
+    // one extra element, the difference of the highest time bin refers to the next bin
+    , fSignals(maxChannelLength+1, 0), fSignalDiffs(maxChannelLength+1, 0) {}
+
+  const TPCRawEventInfo* fEvent;
+  Int_t fDDLNumber;
+  Int_t fHWAddress;
+  Int_t fWordCount;   // ALTRO words of the channel payload: samples and 2 words per bunch
+  std::vector<TPCRawBunch> fBunches;
+  std::vector<UShort_t> fSamples;
+  int fMaxChannelLength;
+  std::vector<Int_t> fSignals;
+  std::vector<Int_t> fSignalDiffs;
+};
+
+/**
+ * Interface of the analyzers of the decoded channels.
+ */
+class TPCRawAnalyzer {
+public:
+  TPCRawAnalyzer() {}
+  virtual ~TPCRawAnalyzer() {}
+
+  /// create an empty instance with the same configuration for a worker
+  virtual TPCRawAnalyzer* Clone() const = 0;
+  /// add the result of a worker instance
+  virtual int Merge(const TPCRawAnalyzer& worker) = 0;
+  /// name of the processing stage in the timing report
+  virtual const char* GetName() const {return "analyzer";}
+  /// the signal arrays of the channel are needed by the analyzer
+  virtual bool NeedsSignalArrays() const {return false;}
+
+  virtual int BeginEvent(const TPCRawEventInfo& /*event*/) {return 0;}
+  virtual int ProcessChannel(const TPCRawChannel& channel) = 0;
+  virtual int EndEvent(const TPCRawEventInfo& /*event*/) {return 0;}
+  /// end of the processing, called for the workers before they are merged
+  /// and for the master instance after merging
+  virtual int Finish() {return 0;}
+
+  /// write the results to the current directory
+  virtual int Write() const {return 0;}
+
+private:
+  TPCRawAnalyzer(const TPCRawAnalyzer&);
+  TPCRawAnalyzer& operator=(const TPCRawAnalyzer&);
+};
+
+/**
+ * Decoding of TPC raw data into the channel buffer and dispatch to the
+ * registered analyzers.
+ */
+class TPCRawDecoder {
+public:
+  TPCRawDecoder(int maxChannelLength=1024, int signalRange=1024)
+    : fChannel(maxChannelLength), fSignalRange(signalRange), fAnalyzers(), fNeedsSignalArrays(false)
+    , fStageTiming(false), fDecodeTime(0.), fSignalArrayTime(0.), fAnalyzerTime(), fInputSize(0) {}
+  ~TPCRawDecoder() {
+    for (unsigned i=0; i<fAnalyzers.size(); i++) delete fAnalyzers[i];
+  }
+
+  /// register an analyzer, the decoder takes ownership
+  int AddAnalyzer(TPCRawAnalyzer* analyzer) {
+    if (!analyzer) return -1;
+    fAnalyzers.push_back(analyzer);
+    fAnalyzerTime.push_back(0.);
+    fNeedsSignalArrays|=analyzer->NeedsSignalArrays();
+    return fAnalyzers.size();
+  }
+
+  /// create a worker instance with empty clones of all analyzers
+  TPCRawDecoder* Clone() const {
+    TPCRawDecoder* clone=new TPCRawDecoder(fChannel.fMaxChannelLength, fSignalRange);
+    clone->fStageTiming=fStageTiming;
+    for (unsigned i=0; i<fAnalyzers.size(); i++) clone->AddAnalyzer(fAnalyzers[i]->Clone());
+    return clone;
+  }
+
+  /// merge the analyzers of a worker instance
+  int Merge(const TPCRawDecoder& worker) {
+    if (worker.fAnalyzers.size()!=fAnalyzers.size()) return -1;
+    for (unsigned i=0; i<fAnalyzers.size(); i++) {
+      fAnalyzers[i]->Merge(*worker.fAnalyzers[i]);
+      fAnalyzerTime[i]+=worker.fAnalyzerTime[i];
+    }
+    fDecodeTime+=worker.fDecodeTime;
+    fSignalArrayTime+=worker.fSignalArrayTime;
+    fInputSize+=worker.fInputSize;
+    return 0;
+  }
+
+  /// finish the processing of all analyzers
+  int Finish() {
+    int result=0;
+    for (unsigned i=0; i<fAnalyzers.size(); i++) {
+      if (fAnalyzers[i]->Finish()<0) result=-1;
+    }
+    return result;
+  }
+
+  /// process all TPC DDLs of the current event of the raw reader, or only the
+  /// specified one or the range up to lastDDL
+  int ProcessEvent(AliRawReader* rawreader, AliAltroRawStreamV3* altrorawstream, TPCRawEventInfo& event, int ddl=-1, bool bVerbose=true, int lastDDL=-1) {
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    double analyzerTime=0.;
+    event.fTimestamp=rawreader->GetTimestamp();
+    fChannel.fEvent=&event;
+    for (unsigned i=0; i<fAnalyzers.size(); i++) fAnalyzers[i]->BeginEvent(event);
+    altrorawstream->Reset();
+    if (ddl<0) {
+      altrorawstream->SelectRawData("TPC");
+    } else {
+      rawreader->Select("TPC", ddl, lastDDL<0?ddl:lastDDL);
+    }
+    int nChannels=0;
+    while (altrorawstream->NextDDL()) {
+      fChannel.fDDLNumber=altrorawstream->GetDDLNumber();
+      fInputSize+=rawreader->GetDataSize();
+      if (bVerbose) {
+        std::cout << " reading event " << std::setw(4) << event.fEvent
+                  << "  DDL " << std::setw(4) << fChannel.fDDLNumber
+                  << std::endl;
+      }
+      while (altrorawstream->NextChannel()) {
+        if (altrorawstream->IsChannelBad()) continue;
+        DecodeChannel(altrorawstream);
+        if (fStageTiming) {
+          std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+          for (unsigned i=0; i<fAnalyzers.size(); i++) {
+            fAnalyzers[i]->ProcessChannel(fChannel);
+            std::chrono::steady_clock::time_point t1=std::chrono::steady_clock::now();
+            double t=std::chrono::duration<double>(t1-t0).count();
+            fAnalyzerTime[i]+=t;
+            analyzerTime+=t;
+            t0=t1;
+          }
+        } else {
+          for (unsigned i=0; i<fAnalyzers.size(); i++) fAnalyzers[i]->ProcessChannel(fChannel);
+        }
+        nChannels++;
+      } // end of channel loop
+    } // end of ddl loop
+    for (unsigned i=0; i<fAnalyzers.size(); i++) fAnalyzers[i]->EndEvent(event);
+    fChannel.fEvent=NULL;
+    if (fStageTiming) {
+      // the decoding is the remaining time of the event
+      fDecodeTime+=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()-analyzerTime;
+    }
+    return nChannels;
+  }
+
+  /// measure the time of the processing stages
+  void SetStageTiming(bool bStageTiming=true) {fStageTiming=bStageTiming;}
+  /// size of the processed raw data in bytes
+  AliHLTUInt64_t GetInputSize() const {return fInputSize;}
+
+  /// print time, event rate and data rate of every stage, all rates refer
+  /// to the raw data size
+  void PrintStageTiming(int nEvents) const {
+    PrintStageHeader();
+    PrintStage("decode", fDecodeTime-fSignalArrayTime, nEvents, fInputSize);
+    if (fNeedsSignalArrays) PrintStage("diff/min normalization", fSignalArrayTime, nEvents, fInputSize);
+    for (unsigned i=0; i<fAnalyzers.size(); i++) {
+      PrintStage(fAnalyzers[i]->GetName(), fAnalyzerTime[i], nEvents, fInputSize);
+    }
+  }
+
+  static void PrintStageHeader() {
+    std::cout << std::left << std::setw(24) << "stage" << std::right
+              << std::setw(12) << "time/s"
+              << std::setw(12) << "events/s"
+              << std::setw(12) << "MB/s"
+              << std::endl;
+  }
+
+  static void PrintStage(const char* name, double time, int nEvents, AliHLTUInt64_t size) {
+    std::streamsize precision=std::cout.precision();
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::setw(12) << std::setprecision(4) << time
+              << std::setw(12) << std::setprecision(4) << (time>0.?nEvents/time:0.)
+              << std::setw(12) << std::setprecision(4) << (time>0.?size/1e6/time:0.)
+              << std::endl;
+    std::cout.precision(precision);
+  }
+
+private:
+  TPCRawDecoder(const TPCRawDecoder&);
+  TPCRawDecoder& operator=(const TPCRawDecoder&);
+
+  int DecodeChannel(AliAltroRawStreamV3* altrorawstream) {
+    fChannel.fHWAddress=altrorawstream->GetHWAddress();
+    fChannel.fWordCount=0;
+    fChannel.fBunches.clear();
+    fChannel.fSamples.clear();
+    while (altrorawstream->NextBunch()) {
+      TPCRawBunch bunch;
+      bunch.fStartTime=altrorawstream->GetStartTimeBin();
+      bunch.fLength=altrorawstream->GetBunchLength();
+      bunch.fOffset=fChannel.fSamples.size();
+      fChannel.fWordCount+=bunch.fLength + 2; // +2 : bunch length and start time words
+      const UShort_t* signals=altrorawstream->GetSignals();
+      fChannel.fSamples.insert(fChannel.fSamples.end(), signals, signals+bunch.fLength);
+      fChannel.fBunches.push_back(bunch);
+    } // end of bunch loop
+    if (fNeedsSignalArrays) {
+      if (fStageTiming) {
+        std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+        FillSignalArrays();
+        fSignalArrayTime+=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+      } else {
+        FillSignalArrays();
+      }
+    }
+    return fChannel.fBunches.size();
+  }
+
+  // Fill the signals into the time bin arrays, the normalization to the minimum
+  // signal found so far is applied after every bunch
+  void FillSignalArrays() {
+    const int maxChannelLength=fChannel.fMaxChannelLength;
+    Int_t* Signals=&fChannel.fSignals[0];
+    Int_t* SignalDiffs=&fChannel.fSignalDiffs[0];
+    memset(Signals, 0, (maxChannelLength+1)*sizeof(Int_t));
+    memset(SignalDiffs, 0, (maxChannelLength+1)*sizeof(Int_t));
+    // search for the minimum signal in this channel and subtract
+    // this from all signals
+    int channelMinSignal=fSignalRange;
+    for (unsigned b=0; b<fChannel.fBunches.size(); b++) {
+      const TPCRawBunch& bunch=fChannel.fBunches[b];
+      const UShort_t* signals=&fChannel.fSamples[bunch.fOffset];
+      Int_t i=0;
+      for (; i<bunch.fLength; i++) {
+        int timeBin=bunch.fStartTime-i;
+        if (channelMinSignal>signals[i]) channelMinSignal=signals[i];
+        if (timeBin<0 || timeBin>=maxChannelLength) continue;
+        Signals[timeBin]=signals[i];
+        SignalDiffs[timeBin]=Signals[timeBin]-Signals[timeBin+1];
+      } // end of bunch signal loop
+      for (i=maxChannelLength-1; i>=0; i--) {
+        if (Signals[i]>=channelMinSignal) Signals[i]-=channelMinSignal;
+        if (i<maxChannelLength-1) SignalDiffs[i]=Signals[i]-Signals[i+1];
+        else SignalDiffs[i]=Signals[i]; // the first signal
+      }
+    }
+  }
+
+  TPCRawChannel fChannel;
+  int fSignalRange;
+  std::vector<TPCRawAnalyzer*> fAnalyzers;
+  bool fNeedsSignalArrays;
+  bool fStageTiming;
+  double fDecodeTime;       // including the signal arrays
+  double fSignalArrayTime;
+  std::vector<double> fAnalyzerTime;
+  AliHLTUInt64_t fInputSize;
+};
+
+/**
+ * Statistics of the ALTRO bunch length and the reduction by the ALTRO RLE
+ * compared to the full channel.
+ *
+ * The tree entries of worker instances are buffered and sorted into the order
+ * of the serial processing in Finish() of the master instance. In parallel
+ * mode, all entries of the run are kept in memory until the end, about 36
+ * byte per channel with signal; the serial processing fills the tree directly.
+ * Without tree and without buffering of the entries, only the histograms are
+ * filled.
+ */
+class TPCRawRLEAnalyzer : public TPCRawAnalyzer {
+public:
+  TPCRawRLEAnalyzer(int maxChannelLength=1000, bool bCreateTree=true, bool bBufferEntries=false)
+    : TPCRawAnalyzer()
+    , fMaxChannelLength(maxChannelLength)
+    , fEntry()
+    , fTree(NULL)
+    , fBufferEntries(bBufferEntries)
+    , fEntries()
+    , fRleReduction(NULL)
+    , fBunchLength(NULL)
+  {
+    if (bCreateTree) {
+      fTree=new TTree("tpcrawbunchlenstat","TPC RAW BunchLength statistics");
+      fTree->Branch("EventNumber"  ,&fEntry.EventNumber  ,"EventNumber/I");
+      fTree->Branch("NofClusters"  ,&fEntry.NofClusters  ,"NofClusters/I");
+      fTree->Branch("DDLNumber"    ,&fEntry.DDLNumber    ,"DDLNumber/I");
+      fTree->Branch("HWAddress"    ,&fEntry.HWAddress    ,"HWAddress/I");
+      fTree->Branch("RCUId"        ,&fEntry.RCUId        ,"RCUId/I");
+      fTree->Branch("NofBunches"   ,&fEntry.NofBunches   ,"NofBunches/I");
+      fTree->Branch("RleReduction" ,&fEntry.RleReduction ,"RleReduction/F");
+    }
+
+    Int_t nBins=100;
+    fRleReduction=new TH1D("hRleReduction", "TPC RLE reduction", nBins, 0, 10);
+    fRleReduction->GetXaxis()->SetTitle("RLE reduction factor");
+    fRleReduction->GetYaxis()->SetTitle("counts");
+    fRleReduction->GetYaxis()->SetTitleOffset(1.4);
+
+    fBunchLength=new TH1D("hBunchLength", "TPC Altro bunch length", maxChannelLength+1, 0, maxChannelLength);
+    fBunchLength->GetXaxis()->SetTitle("TPC Altro bunch length");
+    fBunchLength->GetYaxis()->SetTitle("counts");
+    fBunchLength->GetYaxis()->SetTitleOffset(1.4);
+  }
+  ~TPCRawRLEAnalyzer() {
+    delete fRleReduction;
+    delete fBunchLength;
+  }
+
+  const char* GetName() const {return "RLE statistics";}
+
+  TPCRawAnalyzer* Clone() const {
+    // the workers buffer the entries for the tree of the master instance
+    TPCRawRLEAnalyzer* clone=new TPCRawRLEAnalyzer(fMaxChannelLength, false, fTree!=NULL || fBufferEntries);
+    clone->fRleReduction->SetDirectory(NULL);
+    clone->fBunchLength->SetDirectory(NULL);
+    return clone;
+  }
+
+  int Merge(const TPCRawAnalyzer& worker) {
+    const TPCRawRLEAnalyzer* other=dynamic_cast<const TPCRawRLEAnalyzer*>(&worker);
+    if (!other) return -1;
+    fRleReduction->Add(other->fRleReduction);
+    fBunchLength->Add(other->fBunchLength);
+    fEntries.insert(fEntries.end(), other->fEntries.begin(), other->fEntries.end());
+    return 0;
+  }
+
+  int BeginEvent(const TPCRawEventInfo& event) {
+    fEntry.EventNumber=event.fEventNumber;
+    fEntry.NofClusters=event.fNofClusters;
+    fEntry.Unit=event.fUnit;
+    return 0;
+  }
+
+  int ProcessChannel(const TPCRawChannel& channel) {
+    fEntry.DDLNumber=channel.fDDLNumber;
+    fEntry.HWAddress=channel.fHWAddress;
+    fEntry.NofBunches=channel.fBunches.size();
+    for (unsigned b=0; b<channel.fBunches.size(); b++) {
+      fBunchLength->Fill(channel.fBunches[b].fLength);
+    }
+
+    int channelWordCount=channel.fWordCount;
+    channelWordCount+=(4-channelWordCount%4); // align to group of 4 10bit words
+    if (channelWordCount>0) {
+      fEntry.RleReduction=fMaxChannelLength;
+      fEntry.RleReduction/=channelWordCount;
+    } else {
+      fEntry.RleReduction=0.;
+    }
+    fRleReduction->Fill(fEntry.RleReduction);
+
+    if (fTree) {
+      fTree->Fill();
+    } else if (fBufferEntries) {
+      fEntries.push_back(fEntry);
+    }
+    return 0;
+  }
+
+  int Finish() {
+    if (fTree && fEntries.size()>0) {
+      // entries of the workers in the order of the serial processing
+      std::stable_sort(fEntries.begin(), fEntries.end(), Entry::LessUnit);
+      for (unsigned i=0; i<fEntries.size(); i++) {
+        fEntry=fEntries[i];
+        fTree->Fill();
+      }
+      fEntries.clear();
+    }
+    return 0;
+  }
+
+  int Write() const {
+    if (fTree) {
+      fTree->Print();
+      fTree->Write();
+    }
+    if (fRleReduction)  fRleReduction->Write();
+    if (fBunchLength)   fBunchLength->Write();
+    return 0;
+  }
+
+private:
+  struct Entry {
+    Entry() : Unit(-1), EventNumber(-1), NofClusters(0), DDLNumber(-1), HWAddress(-1), RCUId(-1), NofBunches(0), RleReduction(1.) {}
+    static bool LessUnit(const Entry& a, const Entry& b) {return a.Unit<b.Unit;}
+    int     Unit;
+    Int_t   EventNumber;
+    Int_t   NofClusters;
+    Int_t   DDLNumber;
+    Int_t   HWAddress;
+    Int_t   RCUId;
+    Int_t   NofBunches;
+    Float_t RleReduction;
+  };
+
+  int fMaxChannelLength;
+  // the branch addresses of the tree point to the current entry
+  Entry fEntry;
+  TTree* fTree;
+  bool fBufferEntries;
+  std::vector<Entry> fEntries;
+  TH1* fRleReduction;
+  TH1* fBunchLength;
+};
+
+#endif
@@ -0,0 +1,523 @@
+//-*- Mode: C++ -*-
+#ifndef TPCRAWSIGNALSTORE_H
+#define TPCRAWSIGNALSTORE_H
+/// @file   TPCRawSignalStore.h
+/// @author Matthias.Richter@scieq.net
+/// @date   2026-10-17
+/// @brief  Streaming store of TPC raw channel signals
+///
+/// The store keeps the signals of all channels in a compact binary file with
+/// memory consumption independent of the amount of data. Only the ALTRO bunches
+/// are stored, i.e. the non-zero ranges of the channel. The channels are collected
+/// in chunks per DDL in columnar layout:
+///   uint32 nChannels, nBunches, nSamples
+///   int32  event[nChannels]
+///   uint16 hwaddress[nChannels]
+///   uint16 nbunches[nChannels]
+///   uint16 starttime[nBunches]
+///   uint16 length[nBunches]
+///   uint16 samples[nSamples]
+/// A chunk is closed when it reaches the configured size and handed to a
+/// background thread which compresses it with zlib and writes it to the file.
+/// The number of pending chunks is limited, the processing waits if the writer
+/// can not keep up.
+///
+/// The index at the end of the file holds position, DDL, event range and a mask
+/// of the hardware addresses of every chunk, the reader only reads the chunks
+/// of the selected DDLs and channels:
+///   TPCRawSignalStoreReader reader;
+///   reader.Open("tpc-raw-signals.dat");
+///   reader.Select(ddl, hwaddress);
+///   while (reader.NextChannel()) {
+///     reader.FillSignals(signals, maxChannelLength);
+///   }
+
+#include "TPCRawDecoder.h"
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// index entry of one chunk in the store
+struct TPCRawSignalStoreChunkInfo {
+  enum {
+    kMaxHWAddress = 4096,
+    kMaskWords = kMaxHWAddress/64,
+  };
+
+  TPCRawSignalStoreChunkInfo()
+    : fOffset(0), fCompressedSize(0), fRawSize(0), fDDLNumber(-1)
+    , fFirstEvent(-1), fLastEvent(-1), fNofChannels(0) {
+    memset(fHWAddressMask, 0, sizeof(fHWAddressMask));
+  }
+
+  bool HasHWAddress(int hwaddress) const {
+    if (hwaddress<0 || hwaddress>=kMaxHWAddress) return false;
+    return (fHWAddressMask[hwaddress/64]>>(hwaddress%64))&0x1;
+  }
+  void SetHWAddress(int hwaddress) {
+    if (hwaddress<0 || hwaddress>=kMaxHWAddress) return;
+    fHWAddressMask[hwaddress/64]|=AliHLTUInt64_t(1)<<(hwaddress%64);
+  }
+
+  AliHLTUInt64_t fOffset;          // position of the chunk in the file
+  AliHLTUInt32_t fCompressedSize;  // size in the file, uncompressed if equal to raw size
+  AliHLTUInt32_t fRawSize;         // size of the columnar block
+  Int_t          fDDLNumber;
+  Int_t          fFirstEvent;
+  Int_t          fLastEvent;
+  AliHLTUInt32_t fNofChannels;
+  AliHLTUInt64_t fHWAddressMask[kMaskWords];
+};
+
+/**
+ * Output file of the store with background compression and writing.
+ * Chunks can be added from multiple threads.
+ */
+class TPCRawSignalStoreFile {
+public:
+  TPCRawSignalStoreFile(int maxPendingChunks=8, int compressionLevel=1)
+    : fFile(NULL), fMaxPendingChunks(maxPendingChunks), fCompressionLevel(compressionLevel)
+    , fQueue(), fIndex(), fMutex(), fQueueNotFull(), fQueueNotEmpty(), fThread(), fStop(false), fOffset(0), fWriteError(false) {}
+  ~TPCRawSignalStoreFile() {Close();}
+
+  static const char* Magic() {return "TPCRSIG1";}
+
+  int Open(const char* filename) {
+    if (fFile) return -1;
+    fFile=fopen(filename, "wb");
+    if (!fFile) {
+      std::cerr << "can not open file " << filename << std::endl;
+      return -1;
+    }
+    if (fwrite(Magic(), 1, 8, fFile)!=8) {
+      std::cerr << "can not write to file " << filename << std::endl;
+      fclose(fFile);
+      fFile=NULL;
+      return -1;
+    }
+    fOffset=8;
+    fStop=false;
+    fWriteError=false;
+    fThread=std::thread(&TPCRawSignalStoreFile::Run, this);
+    return 0;
+  }
+
+  /// add a chunk, waits if the maximum number of pending chunks is reached
+  int AddChunk(const TPCRawSignalStoreChunkInfo& info, std::vector<char>& data) {
+    if (!fFile || fWriteError) return -1;
+    std::unique_lock<std::mutex> lock(fMutex);
+    fQueueNotFull.wait(lock, [this] {return (int)fQueue.size()<fMaxPendingChunks;});
+    fQueue.push_back(Job());
+    fQueue.back().fInfo=info;
+    fQueue.back().fData.swap(data);
+    fQueueNotEmpty.notify_one();
+    return 0;
+  }
+
+  /// write the pending chunks and the index, and close the file
+  int Close() {
+    if (!fFile) return 0;
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop=true;
+    }
+    fQueueNotEmpty.notify_all();
+    if (fThread.joinable()) fThread.join();
+
+    AliHLTUInt64_t indexOffset=fOffset;
+    AliHLTUInt64_t nChunks=fIndex.size();
+    // the trailer with the magic marks a complete store, it is not written
+    // after a write error
+    bool bSuccess=!fWriteError;
+    if (bSuccess && nChunks>0) bSuccess=fwrite(&fIndex[0], sizeof(TPCRawSignalStoreChunkInfo), nChunks, fFile)==nChunks;
+    if (bSuccess) bSuccess=fwrite(&indexOffset, sizeof(indexOffset), 1, fFile)==1;
+    if (bSuccess) bSuccess=fwrite(&nChunks, sizeof(nChunks), 1, fFile)==1;
+    if (bSuccess) bSuccess=fwrite(Magic(), 1, 8, fFile)==8;
+    if (fclose(fFile)!=0) bSuccess=false;
+    fFile=NULL;
+    if (!bSuccess) {
+      std::cerr << "signal store: write error, the file is incomplete" << std::endl;
+      return -1;
+    }
+    std::cout << "signal store: " << nChunks << " chunk(s), " << indexOffset << " byte(s) of data" << std::endl;
+    return 0;
+  }
+
+private:
+  TPCRawSignalStoreFile(const TPCRawSignalStoreFile&);
+  TPCRawSignalStoreFile& operator=(const TPCRawSignalStoreFile&);
+
+  struct Job {
+    TPCRawSignalStoreChunkInfo fInfo;
+    std::vector<char> fData;
+  };
+
+  void Run() {
+    std::vector<Bytef> compressed;
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(fMutex);
+        fQueueNotEmpty.wait(lock, [this] {return fStop || !fQueue.empty();});
+        if (fQueue.empty()) break;
+        job.fInfo=fQueue.front().fInfo;
+        job.fData.swap(fQueue.front().fData);
+        fQueue.pop_front();
+      }
+      fQueueNotFull.notify_one();
+
+      uLongf compressedSize=compressBound(job.fData.size());
+      compressed.resize(compressedSize);
+      const char* data=&job.fData[0];
+      AliHLTUInt32_t size=job.fData.size();
+      if (compress2(&compressed[0], &compressedSize, reinterpret_cast<const Bytef*>(data), size, fCompressionLevel)==Z_OK &&
+          compressedSize<size) {
+        data=reinterpret_cast<const char*>(&compressed[0]);
+        size=compressedSize;
+      }
+      job.fInfo.fOffset=fOffset;
+      job.fInfo.fCompressedSize=size;
+      job.fInfo.fRawSize=job.fData.size();
+      if (fWriteError) continue;
+      if (fwrite(data, 1, size, fFile)!=size) {
+        // the remaining chunks are discarded
+        fWriteError=true;
+        continue;
+      }
+      fOffset+=size;
+      fIndex.push_back(job.fInfo);
+    }
+  }
+
+  FILE* fFile;
+  int fMaxPendingChunks;
+  int fCompressionLevel;
+  std::deque<Job> fQueue;
+  // index and offset are only accessed by the writer thread until it is stopped
+  std::vector<TPCRawSignalStoreChunkInfo> fIndex;
+  std::mutex fMutex;
+  std::condition_variable fQueueNotFull;
+  std::condition_variable fQueueNotEmpty;
+  std::thread fThread;
+  bool fStop;
+  AliHLTUInt64_t fOffset;
+  std::atomic<bool> fWriteError;
+};
+
+/**
+ * Analyzer writing the bunches of all channels to the store.
+ *
+ * Worker instances share the output file with the master instance, the
+ * master closes the file when finished.
+ */
+class TPCRawSignalStoreWriter : public TPCRawAnalyzer {
+public:
+  TPCRawSignalStoreWriter(const char* filename, unsigned chunkSize=256*1024)
+    : TPCRawAnalyzer()
+    , fFile(new TPCRawSignalStoreFile)
+    , fOwner(true)
+    , fChunkSize(chunkSize)
+    , fChunks()
+  {
+    if (fFile->Open(filename)<0) fFile.reset();
+  }
+  ~TPCRawSignalStoreWriter() {Finish();}
+
+  const char* GetName() const {return "signal store";}
+
+  TPCRawAnalyzer* Clone() const {
+    TPCRawSignalStoreWriter* clone=new TPCRawSignalStoreWriter(fFile, fChunkSize);
+    return clone;
+  }
+
+  int Merge(const TPCRawAnalyzer& /*worker*/) {
+    // the workers write to the same file
+    return 0;
+  }
+
+  int ProcessChannel(const TPCRawChannel& channel) {
+    if (!fFile) return -1;
+    Chunk& chunk=fChunks[channel.fDDLNumber];
+    int event=channel.fEvent?channel.fEvent->fEventNumber:-1;
+    if (chunk.fInfo.fNofChannels==0) {
+      chunk.fInfo.fDDLNumber=channel.fDDLNumber;
+      chunk.fInfo.fFirstEvent=event;
+    }
+    if (chunk.fInfo.fFirstEvent>event) chunk.fInfo.fFirstEvent=event;
+    if (chunk.fInfo.fLastEvent<event) chunk.fInfo.fLastEvent=event;
+    chunk.fInfo.fNofChannels++;
+    chunk.fInfo.SetHWAddress(channel.fHWAddress);
+    chunk.fEvents.push_back(event);
+    chunk.fHWAddresses.push_back(channel.fHWAddress);
+    chunk.fNofBunches.push_back(channel.fBunches.size());
+    for (unsigned b=0; b<channel.fBunches.size(); b++) {
+      chunk.fStartTimes.push_back(channel.fBunches[b].fStartTime);
+      chunk.fLengths.push_back(channel.fBunches[b].fLength);
+    }
+    chunk.fSamples.insert(chunk.fSamples.end(), channel.fSamples.begin(), channel.fSamples.end());
+    if (chunk.GetSize()>=fChunkSize && WriteChunk(chunk)<0) return -1;
+    return 0;
+  }
+
+  /// write all open chunks, the master instance also closes the file
+  int Finish() {
+    if (!fFile) return 0;
+    int result=0;
+    for (std::map<int, Chunk>::iterator it=fChunks.begin(); it!=fChunks.end(); it++) {
+      if (WriteChunk(it->second)<0) result=-1;
+    }
+    fChunks.clear();
+    if (fOwner && fFile->Close()<0) result=-1;
+    fFile.reset();
+    return result;
+  }
+
+private:
+  TPCRawSignalStoreWriter(std::shared_ptr<TPCRawSignalStoreFile> file, unsigned chunkSize)
+    : TPCRawAnalyzer(), fFile(file), fOwner(false), fChunkSize(chunkSize), fChunks() {}
+
+  /// columnar buffers of one DDL
+  struct Chunk {
+    unsigned GetSize() const {
+      return 3*sizeof(AliHLTUInt32_t)
+        + fEvents.size()*sizeof(Int_t)
+        + (fHWAddresses.size()+fNofBunches.size()+fStartTimes.size()+fLengths.size()+fSamples.size())*sizeof(UShort_t);
+    }
+    void Clear() {
+      fInfo=TPCRawSignalStoreChunkInfo();
+      fEvents.clear();
+      fHWAddresses.clear();
+      fNofBunches.clear();
+      fStartTimes.clear();
+      fLengths.clear();
+      fSamples.clear();
+    }
+    TPCRawSignalStoreChunkInfo fInfo;
+    std::vector<Int_t>    fEvents;
+    std::vector<UShort_t> fHWAddresses;
+    std::vector<UShort_t> fNofBunches;
+    std::vector<UShort_t> fStartTimes;
+    std::vector<UShort_t> fLengths;
+    std::vector<UShort_t> fSamples;
+  };
+
+  template<typename T>
+  static char* AppendColumn(char* target, const std::vector<T>& column) {
+    if (column.size()==0) return target;
+    memcpy(target, &column[0], column.size()*sizeof(T));
+    return target+column.size()*sizeof(T);
+  }
+
+  int WriteChunk(Chunk& chunk) {
+    if (chunk.fInfo.fNofChannels==0) return 0;
+    std::vector<char> data(chunk.GetSize());
+    AliHLTUInt32_t counts[3]={chunk.fInfo.fNofChannels, (AliHLTUInt32_t)chunk.fStartTimes.size(), (AliHLTUInt32_t)chunk.fSamples.size()};
+    char* target=&data[0];
+    memcpy(target, counts, sizeof(counts));
+    target+=sizeof(counts);
+    target=AppendColumn(target, chunk.fEvents);
+    target=AppendColumn(target, chunk.fHWAddresses);
+    target=AppendColumn(target, chunk.fNofBunches);
+    target=AppendColumn(target, chunk.fStartTimes);
+    target=AppendColumn(target, chunk.fLengths);
+    target=AppendColumn(target, chunk.fSamples);
+    int result=fFile->AddChunk(chunk.fInfo, data);
+    chunk.Clear();
+    return result;
+  }
+
+  std::shared_ptr<TPCRawSignalStoreFile> fFile;
+  bool fOwner;
+  unsigned fChunkSize;
+  std::map<int, Chunk> fChunks;
+};
+
+/**
+ * Reader for the signal store, only the chunks containing the selected DDL
+ * and hardware address are read from the file.
+ */
+class TPCRawSignalStoreReader {
+public:
+  TPCRawSignalStoreReader()
+    : fFile(NULL), fIndex(), fSelectedDDL(-1), fSelectedHWAddress(-1)
+    , fCurrentChunk(-1), fCurrentChannel(0), fNofChannels(0), fCurrentBunch(0), fCurrentSample(0)
+    , fBuffer(), fCompressed()
+    , fEvents(NULL), fHWAddresses(NULL), fNofBunches(NULL), fStartTimes(NULL), fLengths(NULL), fSamples(NULL) {}
+  ~TPCRawSignalStoreReader() {Close();}
+
+  int Open(const char* filename) {
+    Close();
+    fFile=fopen(filename, "rb");
+    if (!fFile) {
+      std::cerr << "can not open file " << filename << std::endl;
+      return -1;
+    }
+    char magic[8];
+    AliHLTUInt64_t indexOffset=0;
+    AliHLTUInt64_t nChunks=0;
+    if (fread(magic, 1, 8, fFile)!=8 || memcmp(magic, TPCRawSignalStoreFile::Magic(), 8)!=0 ||
+        fseek(fFile, -(long)(2*sizeof(AliHLTUInt64_t)+8), SEEK_END)!=0 ||
+        fread(&indexOffset, sizeof(indexOffset), 1, fFile)!=1 ||
+        fread(&nChunks, sizeof(nChunks), 1, fFile)!=1 ||
+        fread(magic, 1, 8, fFile)!=8 || memcmp(magic, TPCRawSignalStoreFile::Magic(), 8)!=0) {
+      std::cerr << "file " << filename << " is not a valid signal store" << std::endl;
+      Close();
+      return -1;
+    }
+    fIndex.resize(nChunks);
+    if (nChunks>0 &&
+        (fseek(fFile, indexOffset, SEEK_SET)!=0 ||
+         fread(&fIndex[0], sizeof(TPCRawSignalStoreChunkInfo), nChunks, fFile)!=nChunks)) {
+      std::cerr << "can not read index of signal store " << filename << std::endl;
+      Close();
+      return -1;
+    }
+    Select();
+    return nChunks;
+  }
+
+  void Close() {
+    if (fFile) fclose(fFile);
+    fFile=NULL;
+    fIndex.clear();
+    fCurrentChunk=-1;
+    fNofChannels=0;
+  }
+
+  const std::vector<TPCRawSignalStoreChunkInfo>& GetIndex() const {return fIndex;}
+
+  /// select DDL and hardware address, -1 selects all
+  void Select(int ddl=-1, int hwaddress=-1) {
+    fSelectedDDL=ddl;
+    fSelectedHWAddress=hwaddress;
+    fCurrentChunk=-1;
+    fCurrentChannel=0;
+    fNofChannels=0;
+  }
+
+  /// go to the next selected channel
+  bool NextChannel() {
+    while (true) {
+      if (fCurrentChannel<fNofChannels) {
+        // bunches and samples of the previous channel
+        if (fCurrentChannel>0) {
+          for (int b=0; b<fNofBunches[fCurrentChannel-1]; b++) fCurrentSample+=fLengths[fCurrentBunch+b];
+          fCurrentBunch+=fNofBunches[fCurrentChannel-1];
+        }
+        fCurrentChannel++;
+        if (fSelectedHWAddress<0 || fHWAddresses[fCurrentChannel-1]==fSelectedHWAddress) return true;
+        continue;
+      }
+      if (!ReadNextChunk()) return false;
+    }
+  }
+
+  int GetEvent() const {return fEvents[fCurrentChannel-1];}
+  int GetDDLNumber() const {return fIndex[fCurrentChunk].fDDLNumber;}
+  int GetHWAddress() const {return fHWAddresses[fCurrentChannel-1];}
+  int GetNofBunches() const {return fNofBunches[fCurrentChannel-1];}
+  int GetBunchStartTime(int bunch) const {return fStartTimes[fCurrentBunch+bunch];}
+  int GetBunchLength(int bunch) const {return fLengths[fCurrentBunch+bunch];}
+  const UShort_t* GetBunchSignals(int bunch) const {
+    const UShort_t* signals=fSamples+fCurrentSample;
+    for (int b=0; b<bunch; b++) signals+=fLengths[fCurrentBunch+b];
+    return signals;
+  }
+
+  /// fill the signals of the current channel into the time bin array
+  int FillSignals(Int_t* signals, int maxChannelLength) const {
+    memset(signals, 0, maxChannelLength*sizeof(Int_t));
+    const UShort_t* samples=fSamples+fCurrentSample;
+    for (int b=0; b<GetNofBunches(); b++) {
+      int startTime=GetBunchStartTime(b);
+      for (int i=0; i<GetBunchLength(b); i++, samples++) {
+        int timeBin=startTime-i;
+        if (timeBin>=0 && timeBin<maxChannelLength) signals[timeBin]=*samples;
+      }
+    }
+    return GetNofBunches();
+  }
+
+private:
+  TPCRawSignalStoreReader(const TPCRawSignalStoreReader&);
+  TPCRawSignalStoreReader& operator=(const TPCRawSignalStoreReader&);
+
+  bool ReadNextChunk() {
+    fCurrentChannel=0;
+    fNofChannels=0;
+    fCurrentBunch=0;
+    fCurrentSample=0;
+    for (fCurrentChunk++; fCurrentChunk<(int)fIndex.size(); fCurrentChunk++) {
+      const TPCRawSignalStoreChunkInfo& info=fIndex[fCurrentChunk];
+      if (fSelectedDDL>=0 && info.fDDLNumber!=fSelectedDDL) continue;
+      if (fSelectedHWAddress>=0 && !info.HasHWAddress(fSelectedHWAddress)) continue;
+      if (ReadChunk(info)<0) continue;
+      return true;
+    }
+    return false;
+  }
+
+  int ReadChunk(const TPCRawSignalStoreChunkInfo& info) {
+    fBuffer.resize(info.fRawSize);
+    if (info.fRawSize<3*sizeof(AliHLTUInt32_t)) return -1;
+    if (fseek(fFile, info.fOffset, SEEK_SET)!=0) return -1;
+    if (info.fCompressedSize==info.fRawSize) {
+      if (fread(&fBuffer[0], 1, info.fRawSize, fFile)!=info.fRawSize) return -1;
+    } else {
+      fCompressed.resize(info.fCompressedSize);
+      if (fread(&fCompressed[0], 1, info.fCompressedSize, fFile)!=info.fCompressedSize) return -1;
+      uLongf size=info.fRawSize;
+      if (uncompress(reinterpret_cast<Bytef*>(&fBuffer[0]), &size, &fCompressed[0], info.fCompressedSize)!=Z_OK ||
+          size!=info.fRawSize) {
+        std::cerr << "signal store: failed to decompress chunk at offset " << info.fOffset << std::endl;
+        return -1;
+      }
+    }
+    const AliHLTUInt32_t* counts=reinterpret_cast<const AliHLTUInt32_t*>(&fBuffer[0]);
+    AliHLTUInt32_t nChannels=counts[0];
+    AliHLTUInt32_t nBunches=counts[1];
+    AliHLTUInt32_t nSamples=counts[2];
+    if (3*sizeof(AliHLTUInt32_t)+nChannels*sizeof(Int_t)+(2*nChannels+2*nBunches+nSamples)*sizeof(UShort_t)!=info.fRawSize) {
+      std::cerr << "signal store: inconsistent chunk at offset " << info.fOffset << std::endl;
+      return -1;
+    }
+    const char* column=&fBuffer[0]+3*sizeof(AliHLTUInt32_t);
+    fEvents=reinterpret_cast<const Int_t*>(column);         column+=nChannels*sizeof(Int_t);
+    fHWAddresses=reinterpret_cast<const UShort_t*>(column); column+=nChannels*sizeof(UShort_t);
+    fNofBunches=reinterpret_cast<const UShort_t*>(column);  column+=nChannels*sizeof(UShort_t);
+    fStartTimes=reinterpret_cast<const UShort_t*>(column);  column+=nBunches*sizeof(UShort_t);
+    fLengths=reinterpret_cast<const UShort_t*>(column);     column+=nBunches*sizeof(UShort_t);
+    fSamples=reinterpret_cast<const UShort_t*>(column);
+    fNofChannels=nChannels;
+    return nChannels;
+  }
+
+  FILE* fFile;
+  std::vector<TPCRawSignalStoreChunkInfo> fIndex;
+  int fSelectedDDL;
+  int fSelectedHWAddress;
+  int fCurrentChunk;
+  int fCurrentChannel;   // one behind the current channel in the chunk
+  int fNofChannels;
+  int fCurrentBunch;     // first bunch of the current channel
+  int fCurrentSample;    // first sample of the current channel
+  std::vector<char> fBuffer;
+  std::vector<Bytef> fCompressed;
+  const Int_t*    fEvents;
+  const UShort_t* fHWAddresses;
+  const UShort_t* fNofBunches;
+  const UShort_t* fStartTimes;
+  const UShort_t* fLengths;
+  const UShort_t* fSamples;
+};
+
+#endif
@@ -0,0 +1,228 @@
+//-*- Mode: C++ -*-
+#ifndef TPCSPACEPOINTINDEX_H
+#define TPCSPACEPOINTINDEX_H
+/// @file   TPCSpacePointIndex.h
+/// @author Matthias.Richter@scieq.net
+/// @date   2026-10-17
+/// @brief  Spatial index of TPC space points for the association with tracks
+///
+/// The space points are grouped by slice, partition and padrow using the
+/// same id as the track points of AliHLTTPCTrackGeometry. Inside every row,
+/// the points are sorted by the cell of a grid in the local coordinates y and
+/// z in cm, the nearest space point of a track point is searched in the
+/// neighbouring cells only. The cell size equals the association window. Only
+/// the points are stored, the cells are found by binary search in the sorted
+/// points.
+///
+/// The track points of all tracks can be calculated in parallel by
+/// CalculateTrackGeometries. The interpreter of ROOT5 can not parse the
+/// thread pool, the header is compiled and loaded before the macros:
+/// .L TPCSpacePointIndex.h+
+
+#include "AliHLTSpacePointContainer.h"
+#include "AliHLTTPCSpacePointData.h"
+#include "AliHLTTPCTransform.h"
+#include "AliHLTTPCTrackGeometry.h"
+#include "AliHLTGlobalBarrelTrack.h"
+#include "TClonesArray.h"
+#include "TH2.h"
+#include "TROOT.h"
+#include "RVersion.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,6,0)
+#include "TThread.h"
+#endif
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+
+class TPCSpacePointIndex {
+public:
+  TPCSpacePointIndex(float maxDY=1.5, float maxDZ=1.5)
+    : fMaxDY(maxDY), fMaxDZ(maxDZ), fRows(), fUsed(), fNofPoints(0), fNofUnmappedPoints(0) {}
+  ~TPCSpacePointIndex() {}
+
+  /// build the index from all space points of the container
+  int Build(const AliHLTSpacePointContainer& points) {
+    fRows.clear();
+    fNofUnmappedPoints=0;
+    std::vector<AliHLTUInt32_t> ids;
+    points.GetClusterIDs(ids);
+    for (unsigned i=0; i<ids.size(); i++) {
+      AliHLTUInt32_t id=ids[i];
+      int slice=AliHLTTPCSpacePointData::GetSlice(id);
+      int partition=AliHLTTPCSpacePointData::GetPatch(id);
+      int padrow=AliHLTTPCTransform::GetPadRow(points.GetX(id));
+      if (padrow<0) {
+        // can not be associated
+        fNofUnmappedPoints++;
+        continue;
+      }
+      Row& r=fRows[AliHLTTPCSpacePointData::GetID(slice, partition, padrow)];
+      Entry entry;
+      entry.fId=id;
+      entry.fY=points.GetY(id);
+      entry.fZ=points.GetZ(id);
+      r.fEntries.push_back(entry);
+    }
+
+    // sort the entries of every row into the cells
+    fNofPoints=0;
+    for (std::map<AliHLTUInt32_t, Row>::iterator it=fRows.begin(); it!=fRows.end(); it++) {
+      Row& r=it->second;
+      float maxY=r.fEntries[0].fY;
+      float maxZ=r.fEntries[0].fZ;
+      r.fMinY=maxY;
+      r.fMinZ=maxZ;
+      for (unsigned i=0; i<r.fEntries.size(); i++) {
+        r.fMinY=std::min(r.fMinY, r.fEntries[i].fY);
+        r.fMinZ=std::min(r.fMinZ, r.fEntries[i].fZ);
+        maxY=std::max(maxY, r.fEntries[i].fY);
+        maxZ=std::max(maxZ, r.fEntries[i].fZ);
+      }
+      r.fNY=(int)((maxY-r.fMinY)/fMaxDY)+1;
+      r.fNZ=(int)((maxZ-r.fMinZ)/fMaxDZ)+1;
+      for (unsigned i=0; i<r.fEntries.size(); i++) {
+        r.fEntries[i].fCell=GetCell(r, r.fEntries[i].fY, r.fEntries[i].fZ);
+      }
+      std::sort(r.fEntries.begin(), r.fEntries.end(), Entry::LessCell);
+      r.fOffset=fNofPoints;
+      fNofPoints+=r.fEntries.size();
+    }
+    fUsed.assign(fNofPoints, false);
+    if (fNofUnmappedPoints>0) {
+      std::cout << "TPCSpacePointIndex: " << fNofUnmappedPoints << " space point(s) without padrow" << std::endl;
+    }
+    return fNofPoints;
+  }
+
+  /// find the nearest unused space point in the window around the track point,
+  /// the point is marked used
+  bool FindNearest(AliHLTUInt32_t trackPointId, float y, float z, AliHLTUInt32_t& spacePointId, float& dy, float& dz) {
+    std::map<AliHLTUInt32_t, Row>::iterator it=fRows.find(trackPointId);
+    if (it==fRows.end()) return false;
+    Row& r=it->second;
+    int cellY=(int)std::floor((y-r.fMinY)/fMaxDY);
+    int cellZ=(int)std::floor((z-r.fMinZ)/fMaxDZ);
+    int best=-1;
+    float bestDistance=0.;
+    int minZ=std::max(cellZ-1, 0);
+    int maxZ=std::min(cellZ+1, r.fNZ-1);
+    if (minZ>maxZ) return false;
+    for (int iy=std::max(cellY-1, 0); iy<=std::min(cellY+1, r.fNY-1); iy++) {
+      // the neighbouring cells in z are consecutive in the sorted entries
+      Entry first;
+      first.fCell=iy*r.fNZ+minZ;
+      int lastCell=iy*r.fNZ+maxZ;
+      std::vector<Entry>::const_iterator begin=std::lower_bound(r.fEntries.begin(), r.fEntries.end(), first, Entry::LessCell);
+      for (int i=begin-r.fEntries.begin(); i<(int)r.fEntries.size() && r.fEntries[i].fCell<=lastCell; i++) {
+        if (fUsed[r.fOffset+i]) continue;
+        float ddy=r.fEntries[i].fY-y;
+        float ddz=r.fEntries[i].fZ-z;
+        if (std::fabs(ddy)>fMaxDY || std::fabs(ddz)>fMaxDZ) continue;
+        float distance=ddy*ddy+ddz*ddz;
+        if (best<0 || distance<bestDistance) {
+          best=i;
+          bestDistance=distance;
+        }
+      }
+    }
+    if (best<0) return false;
+    fUsed[r.fOffset+best]=true;
+    spacePointId=r.fEntries[best].fId;
+    dy=r.fEntries[best].fY-y;
+    dz=r.fEntries[best].fZ-z;
+    return true;
+  }
+
+  /// associate the nearest unused space points with the track points of the
+  /// track, the residuals in cm are filled into the optional histograms
+  int AssociateTrack(int trackID, const AliHLTTPCTrackGeometry& geometry, AliHLTSpacePointContainer& points, TH2* residualY=NULL, TH2* residualZ=NULL) {
+    std::vector<AliHLTUInt32_t> associated;
+    const std::vector<AliHLTTrackGeometry::AliHLTTrackPoint>& trackPoints=geometry.GetTrackPoints();
+    for (unsigned i=0; i<trackPoints.size(); i++) {
+      AliHLTUInt32_t spacePointId=0;
+      float dy=0., dz=0.;
+      if (!FindNearest(trackPoints[i].GetId(), trackPoints[i].GetU(), trackPoints[i].GetV(), spacePointId, dy, dz)) continue;
+      associated.push_back(spacePointId);
+      if (residualY) residualY->Fill(points.GetX(spacePointId), dy);
+      if (residualZ) residualZ->Fill(points.GetX(spacePointId), dz);
+    }
+    if (associated.size()>0) points.SetTrackID(trackID, &associated[0], associated.size());
+    return associated.size();
+  }
+
+  /// number of space points which could not be mapped to a padrow
+  int GetNofUnmappedPoints() const {return fNofUnmappedPoints;}
+
+private:
+  TPCSpacePointIndex(const TPCSpacePointIndex&);
+  TPCSpacePointIndex& operator=(const TPCSpacePointIndex&);
+
+  struct Entry {
+    static bool LessCell(const Entry& a, const Entry& b) {return a.fCell<b.fCell;}
+    AliHLTUInt32_t fId;
+    float fY;
+    float fZ;
+    int fCell;
+  };
+
+  struct Row {
+    Row() : fMinY(0.), fMinZ(0.), fNY(0), fNZ(0), fOffset(0), fEntries() {}
+    float fMinY;
+    float fMinZ;
+    int fNY;
+    int fNZ;
+    int fOffset;                 // offset in the used flags
+    std::vector<Entry> fEntries; // sorted by cell
+  };
+
+  int GetCell(const Row& r, float y, float z) const {
+    int cellY=std::min((int)((y-r.fMinY)/fMaxDY), r.fNY-1);
+    int cellZ=std::min((int)((z-r.fMinZ)/fMaxDZ), r.fNZ-1);
+    return cellY*r.fNZ+cellZ;
+  }
+
+  float fMaxDY;
+  float fMaxDZ;
+  std::map<AliHLTUInt32_t, Row> fRows;
+  std::vector<bool> fUsed;
+  int fNofPoints;
+  int fNofUnmappedPoints;
+};
+
+/// create the track geometries and calculate the track points of all tracks
+/// in a pool of threads, the geometry is set for the tracks
+inline int CalculateTrackGeometries(TClonesArray& tracks, int nThreads=0)
+{
+  if (nThreads<=0) nThreads=std::max(1u, std::thread::hardware_concurrency());
+  int nTracks=tracks.GetEntriesFast();
+  std::vector<AliHLTTPCTrackGeometry*> geometries(nTracks, NULL);
+  for (int tix=0; tix<nTracks; tix++) geometries[tix]=new AliHLTTPCTrackGeometry;
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+  std::atomic<int> nextTrack(0);
+  std::vector<std::thread> pool;
+  for (int i=0; i<nThreads; i++) {
+    pool.push_back(std::thread([&] () {
+          for (int tix=nextTrack++; tix<nTracks; tix=nextTrack++) {
+            geometries[tix]->CalculateTrackPoints(*(AliHLTGlobalBarrelTrack*)tracks.UncheckedAt(tix));
+          }
+        }));
+  }
+  for (auto& thread : pool) thread.join();
+
+  for (int tix=0; tix<nTracks; tix++) {
+    ((AliHLTGlobalBarrelTrack*)tracks.UncheckedAt(tix))->SetTrackGeometry(geometries[tix]);
+  }
+  return nTracks;
+}
+
+#endif
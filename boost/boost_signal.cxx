@@ -1,7 +1,14 @@
 #include <boost/signals2.hpp>
 #include <vector>
 #include <iostream>
+#include <iomanip>
 #include <cstring>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 using boost::signals2::signal;
 using std::vector;
@@ -15,11 +22,18 @@ typedef signal<char* (unsigned)> callback_signal_t;
 // and a nice description of lambda functions
 // http://www.cprogramming.com/c++11/c++11-lambda-closures.html
 //
+// The buffers can alternatively be provided by a preallocated BufferPool
+// through a BufferCallback, a plain function pointer for exactly one
+// consumer without lock and allocation on the call. The microbenchmark
+// compares requests/s and latency of the buffer request with the signals2
+// version:
+// ./boost_signal bench [nThreads] [nRequests]
+//
 // compilation:
 // Note: because of the include file hierarchy of the boost libraries,
 // BOOST_INCLUDE_DIR points to include directory containing the 'boost'
 // include folder
-// g++ -o boost_signal -I$BOOST_INCLUDE_DIR -std=c++11 boost_signal.cxx
+// g++ -O2 -o boost_signal -I$BOOST_INCLUDE_DIR -std=c++17 -pthread boost_signal.cxx
 
 struct HelloWorld 
 {
@@ -29,6 +43,212 @@ struct HelloWorld
   } 
 };
 
+// Index of the calling thread in the per-thread free lists of the buffer
+// pools. The index is given back when the thread terminates and is reused by
+// the next thread together with the buffers cached for it. Threads beyond
+// the maximum get -1 and use the shared free lists.
+class ThreadSlot
+{
+public:
+  static const int kMaxThreads=64;
+
+  static int index() {
+    thread_local ThreadSlot slot;
+    return slot.mIndex;
+  }
+
+private:
+  ThreadSlot() : mIndex(-1) {
+    std::lock_guard<std::mutex> lock(mutex());
+    for (int i=0; i<kMaxThreads; i++) {
+      if (used()[i]) continue;
+      used()[i]=true;
+      mIndex=i;
+      break;
+    }
+  }
+  ~ThreadSlot() {
+    if (mIndex<0) return;
+    std::lock_guard<std::mutex> lock(mutex());
+    used()[mIndex]=false;
+  }
+
+  static std::mutex& mutex() {static std::mutex m; return m;}
+  static vector<bool>& used() {static vector<bool> u(kMaxThreads, false); return u;}
+
+  int mIndex;
+};
+
+// Buffer pool with power of two size classes from 64 byte up to the maximum
+// buffer size. All buffers are preallocated in one arena. Every thread keeps
+// its own free list per size class, a buffer is taken from and recycled to
+// the list of the calling thread without lock. The shared free list of a
+// size class is only accessed to move a batch of buffers when the thread list
+// runs empty or full.
+// allocate returns nullptr if the size exceeds the maximum buffer size or the
+// size class is exhausted.
+class BufferPool
+{
+public:
+  BufferPool(unsigned maxBufferSize, unsigned nBuffersPerClass)
+    : mNClasses(0)
+    , mArena()
+    , mClassBegin()
+    , mShared()
+    , mLocal()
+  {
+    while ((kMinSize<<mNClasses)<maxBufferSize) mNClasses++;
+    mNClasses++;
+    size_t arenaSize=0;
+    for (unsigned c=0; c<mNClasses; c++) {
+      mClassBegin.push_back(arenaSize);
+      arenaSize+=size_t(nBuffersPerClass)*(kMinSize<<c);
+    }
+    mClassBegin.push_back(arenaSize);
+    mArena.resize(arenaSize);
+
+    mShared=vector<SharedList>(mNClasses);
+    for (unsigned c=0; c<mNClasses; c++) {
+      mShared[c].buffers.reserve(nBuffersPerClass);
+      for (unsigned i=nBuffersPerClass; i-->0;) {
+        mShared[c].buffers.push_back(&mArena[mClassBegin[c]+size_t(i)*(kMinSize<<c)]);
+      }
+    }
+    mLocal=vector<LocalList>(ThreadSlot::kMaxThreads*mNClasses);
+    for (auto& list : mLocal) list.buffers.reserve(2*kBatch);
+  }
+  ~BufferPool() {}
+
+  char* allocate(unsigned size) {
+    int c=sizeClass(size);
+    if (c<0) return nullptr;
+    int slot=ThreadSlot::index();
+    if (slot<0) {
+      SharedList& shared=mShared[c];
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      if (shared.buffers.empty()) return nullptr;
+      char* buffer=shared.buffers.back();
+      shared.buffers.pop_back();
+      return buffer;
+    }
+    vector<char*>& local=mLocal[slot*mNClasses+c].buffers;
+    if (local.empty()) {
+      SharedList& shared=mShared[c];
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      unsigned n=std::min<size_t>(kBatch, shared.buffers.size());
+      local.insert(local.end(), shared.buffers.end()-n, shared.buffers.end());
+      shared.buffers.resize(shared.buffers.size()-n);
+    }
+    if (local.empty()) return nullptr;
+    char* buffer=local.back();
+    local.pop_back();
+    return buffer;
+  }
+
+  // the buffer is recycled to the calling thread, it does not need to be the
+  // thread which allocated the buffer
+  void release(char* buffer) {
+    if (buffer==nullptr || buffer<&mArena[0] || buffer>=&mArena[0]+mArena.size()) return;
+    size_t offset=buffer-&mArena[0];
+    unsigned c=0;
+    while (offset>=mClassBegin[c+1]) c++;
+    int slot=ThreadSlot::index();
+    if (slot<0) {
+      SharedList& shared=mShared[c];
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.buffers.push_back(buffer);
+      return;
+    }
+    vector<char*>& local=mLocal[slot*mNClasses+c].buffers;
+    if (local.size()>=2*kBatch) {
+      SharedList& shared=mShared[c];
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.buffers.insert(shared.buffers.end(), local.end()-kBatch, local.end());
+      local.resize(local.size()-kBatch);
+    }
+    local.push_back(buffer);
+  }
+
+  unsigned maxBufferSize() const {return kMinSize<<(mNClasses-1);}
+
+private:
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  static const unsigned kMinSize=64;
+  static const unsigned kBatch=32;
+
+  int sizeClass(unsigned size) const {
+    unsigned c=0;
+    while (c<mNClasses && (kMinSize<<c)<size) c++;
+    return c<mNClasses?c:-1;
+  }
+
+  struct SharedList {
+    std::mutex mutex;
+    vector<char*> buffers;
+  };
+
+  // aligned to a cache line to avoid false sharing between the threads, the
+  // storage of the vector is aligned with the aligned new of C++17
+  struct alignas(64) LocalList {
+    vector<char*> buffers;
+  };
+
+  unsigned mNClasses;
+  vector<char> mArena;
+  vector<size_t> mClassBegin;
+  vector<SharedList> mShared;
+  vector<LocalList> mLocal;
+};
+
+// Callback for exactly one consumer: function pointer and object, the call
+// neither locks nor allocates. The callback is not changed while it is
+// called.
+class BufferCallback
+{
+public:
+  BufferCallback() : mFunction(nullptr), mObject(nullptr) {}
+  ~BufferCallback() {}
+
+  // bind a member function of an object
+  template<typename T, char* (T::*Method)(unsigned)>
+  void bind(T* object) {
+    mObject=object;
+    mFunction=&callMethod<T, Method>;
+  }
+
+  // bind a function object, e.g. a lambda, which must outlive the callback
+  template<typename F>
+  void bind(F* functor) {
+    mObject=functor;
+    mFunction=&callFunctor<F>;
+  }
+
+  void reset() {mFunction=nullptr; mObject=nullptr;}
+  explicit operator bool() const {return mFunction!=nullptr;}
+
+  char* operator()(unsigned size) const {
+    return mFunction(mObject, size);
+  }
+
+private:
+  typedef char* (*function_t)(void*, unsigned);
+
+  template<typename T, char* (T::*Method)(unsigned)>
+  static char* callMethod(void* object, unsigned size) {
+    return (static_cast<T*>(object)->*Method)(size);
+  }
+
+  template<typename F>
+  static char* callFunctor(void* functor, unsigned size) {
+    return (*static_cast<F*>(functor))(size);
+  }
+
+  function_t mFunction;
+  void* mObject;
+};
+
 class Worker
 {
 public:
@@ -39,8 +259,7 @@ public:
     const char* text="the white little shark";
     unsigned size=10;
     std::cout << "Worker: request Buffer of size " << size << std::endl;
-    // return type of the signal is boost::optional<> which needs to be dereferenced
-    char* buffer=*m_cbsignal(size);
+    char* buffer=requestBuffer(size);
     if (buffer) {
       strncpy(buffer, text, size-1);
     } else {
@@ -49,7 +268,7 @@ public:
 
     size=17;
     std::cout << "Worker: request Buffer of size " << size << std::endl;
-    buffer=*m_cbsignal(size);
+    buffer=requestBuffer(size);
     if (buffer) {
       strncpy(buffer, text, size-1);
     } else {
@@ -58,9 +277,24 @@ public:
     return size;
   }
 
+  char* requestBuffer(unsigned size) {
+    if (m_callback) return m_callback(size);
+    // return type of the signal is boost::optional<> which needs to be dereferenced
+    return *m_cbsignal(size);
+  }
+
   int registerCallback(callback_signal_t::slot_function_type host) {
+    m_callback.reset();
     m_cbsignal.disconnect_all_slots();
     m_cbsignal.connect(host);
+    return 0;
+  }
+
+  // single consumer, replaces the signal
+  int registerCallback(const BufferCallback& host) {
+    m_cbsignal.disconnect_all_slots();
+    m_callback=host;
+    return 0;
   }
 
 private:
@@ -71,9 +305,11 @@ private:
     } else {
       std::cout << "Worker: no buffer provided by host" << std::endl;
     }
+    return size;
   }
 
   callback_signal_t m_cbsignal;
+  BufferCallback m_callback;
 
 };
 
@@ -101,8 +337,157 @@ private:
   vector<char*> mBuffers;
 };
 
-int main ()
+// Host handing out buffers of the pool, the buffers are given back after use
+class PoolHost
 {
+public:
+  PoolHost(unsigned maxBufferSize=4096, unsigned nBuffersPerClass=1024) : mPool(maxBufferSize, nBuffersPerClass) {};
+  ~PoolHost() {};
+
+  char* createBuffer(unsigned size) {return mPool.allocate(size);}
+  void releaseBuffer(char* buffer) {mPool.release(buffer);}
+
+private:
+  BufferPool mPool;
+};
+
+// request sizes of the benchmark, the buffers are kept in flight for a number
+// of requests before being released
+const unsigned kRequestSizes[]={10, 17, 64, 100, 256, 1000, 1500, 4096};
+const unsigned kNRequestSizes=sizeof(kRequestSizes)/sizeof(kRequestSizes[0]);
+const unsigned kInFlight=8;
+// maximum number of latency samples per thread
+const unsigned kMaxLatencySamples=200000;
+
+// run the requests of one thread, the latency of the buffer request is
+// measured if the target is provided
+template<typename Release>
+unsigned runRequests(Worker& worker, Release release, unsigned nRequests, vector<double>* latencies)
+{
+  char* inFlight[kInFlight]={};
+  unsigned nFailed=0;
+  for (unsigned i=0; i<nRequests; i++) {
+    unsigned size=kRequestSizes[i%kNRequestSizes];
+    char*& slot=inFlight[i%kInFlight];
+    if (slot) release(slot);
+    char* buffer=nullptr;
+    if (latencies) {
+      auto start=std::chrono::steady_clock::now();
+      buffer=worker.requestBuffer(size);
+      (*latencies)[i]=std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count();
+    } else {
+      buffer=worker.requestBuffer(size);
+    }
+    if (buffer) {
+      buffer[0]=buffer[size-1]=1;
+    } else {
+      nFailed++;
+    }
+    slot=buffer;
+  }
+  for (auto buffer : inFlight) if (buffer) release(buffer);
+  return nFailed;
+}
+
+// run the requests in a number of threads, every thread has its own worker
+// with a callback registered by the setup function
+template<typename Setup, typename Release>
+void benchmark(const char* name, Setup setup, Release release, unsigned nThreads, unsigned nRequests)
+{
+  vector<Worker> workers(nThreads);
+  for (auto& worker : workers) setup(worker);
+  unsigned nSamples=std::min(nRequests, kMaxLatencySamples);
+  vector<vector<double> > latencies(nThreads, vector<double>(nSamples, 0.));
+  std::atomic<unsigned> nFailed(0);
+
+  double elapsed[2]={0., 0.};
+  for (int pass=0; pass<2; pass++) {
+    // first pass: throughput, second pass: latency of every request
+    std::atomic<bool> go(false);
+    vector<std::thread> pool;
+    for (unsigned t=0; t<nThreads; t++) {
+      pool.push_back(std::thread([&, t, pass] () {
+            while (!go) std::this_thread::yield();
+            nFailed+=runRequests(workers[t], release, pass==0?nRequests:nSamples, pass==0?nullptr:&latencies[t]);
+          }));
+    }
+    auto start=std::chrono::steady_clock::now();
+    go=true;
+    for (auto& thread : pool) thread.join();
+    elapsed[pass]=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  }
+
+  vector<double> all;
+  all.reserve(size_t(nThreads)*nSamples);
+  for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  auto percentile=[&all] (double p) {
+    size_t n=std::min(all.size()-1, size_t(p*all.size()));
+    std::nth_element(all.begin(), all.begin()+n, all.end());
+    return all[n];
+  };
+  double p50=percentile(0.5);
+  double p99=percentile(0.99);
+  double p999=percentile(0.999);
+  double max=*std::max_element(all.begin(), all.end());
+
+  std::cout << std::left << std::setw(20) << name << std::right
+            << std::setw(14) << std::setprecision(4) << nThreads*double(nRequests)/elapsed[0]
+            << std::setw(10) << std::setprecision(4) << p50
+            << std::setw(10) << std::setprecision(4) << p99
+            << std::setw(10) << std::setprecision(4) << p999
+            << std::setw(12) << std::setprecision(4) << max;
+  if (nFailed>0) std::cout << "  " << nFailed << " failed request(s)";
+  std::cout << std::endl;
+}
+
+int runBenchmark(unsigned nThreads, unsigned nRequests)
+{
+  std::cout << "benchmark: " << nRequests << " buffer request(s) per thread" << std::endl;
+  std::cout << std::left << std::setw(20) << "" << std::right
+            << std::setw(14) << "requests/s"
+            << std::setw(10) << "p50/ns"
+            << std::setw(10) << "p99/ns"
+            << std::setw(10) << "p99.9/ns"
+            << std::setw(12) << "max/ns"
+            << std::endl;
+
+  vector<unsigned> threadCounts(1, 1);
+  if (nThreads>1) threadCounts.push_back(nThreads);
+  for (unsigned n : threadCounts) {
+    std::cout << n << " thread(s)" << std::endl;
+    // enough buffers for the buffers in flight and the per-thread free lists
+    PoolHost host(4096, n*(kInFlight+64)+64);
+    auto allocateNew=[] (unsigned size) {return new char[size];};
+    auto releaseNew=[] (char* buffer) {delete [] buffer;};
+    auto releasePool=[&host] (char* buffer) {host.releaseBuffer(buffer);};
+
+    benchmark("signals2 + new", [&] (Worker& worker) {
+        worker.registerCallback(allocateNew);
+      }, releaseNew, n, nRequests);
+    benchmark("signals2 + pool", [&] (Worker& worker) {
+        worker.registerCallback([&host] (unsigned size) {return host.createBuffer(size);});
+      }, releasePool, n, nRequests);
+    benchmark("callback + pool", [&] (Worker& worker) {
+        BufferCallback callback;
+        callback.bind<PoolHost, &PoolHost::createBuffer>(&host);
+        worker.registerCallback(callback);
+      }, releasePool, n, nRequests);
+  }
+  return 0;
+}
+
+int main (int argc, char** argv)
+{
+  if (argc>1 && strcmp(argv[1], "bench")==0) {
+    int nThreads=argc>2?atoi(argv[2]):std::max(2u, std::thread::hardware_concurrency());
+    int nRequests=argc>3?atoi(argv[3]):1000000;
+    if (nThreads<=0 || nRequests<=0) {
+      std::cerr << "invalid arguments, usage: " << argv[0] << " bench [nThreads] [nRequests], both > 0" << std::endl;
+      return 1;
+    }
+    return runBenchmark(nThreads, nRequests);
+  }
+
   // Signal with no arguments and a void return value
   signal<void ()> sig;
 
@@ -127,6 +512,12 @@ int main ()
   worker.registerCallback([phost](unsigned size) {return phost->createBuffer(size);} );
   worker.convert();
 
+  // single consumer callback bound to the member function of the host
+  BufferCallback callback;
+  callback.bind<Host, &Host::createBuffer>(&host2);
+  worker.registerCallback(callback);
+  worker.convert();
+
   host1.print();
   host2.print();
 